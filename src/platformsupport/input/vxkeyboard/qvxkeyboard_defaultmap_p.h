@@ -21,7 +21,10 @@
 
 // no QT_BEGIN_NAMESPACE, since we include it internally...
 
-const QKeyboardMap::Mapping QVxKeyboardHandler::s_keymap_default[] = {
+// Generated sorted by keycode: the handler binary-searches this table and
+// builds its keycode index over it without re-sorting at startup, which the
+// static_assert below guarantees stays valid.
+constexpr QKeyboardMap::Mapping s_keymap_default[] = {
     {   1, 0xffff, 0x01000000, 0x00, 0x00, 0x0000 },
     {   2, 0x0031, 0x00000031, 0x00, 0x00, 0x0000 },
     {   2, 0x0021, 0x00000021, 0x01, 0x00, 0x0000 },
@@ -610,7 +613,7 @@ const QKeyboardMap::Mapping QVxKeyboardHandler::s_keymap_default[] = {
     { 111, 0xffff, 0x01000000, 0x0c, 0x08, 0x0200 },
 };
 
-const QKeyboardMap::Composing QVxKeyboardHandler::s_keycompose_default[] = {
+constexpr QKeyboardMap::Composing s_keycompose_default[] = {
     { 0x0060, 0x0041, 0x00c0 },
     { 0x0060, 0x0061, 0x00e0 },
     { 0x0027, 0x0041, 0x00c1 },
@@ -760,4 +763,17 @@ const QKeyboardMap::Composing QVxKeyboardHandler::s_keycompose_default[] = {
     { 0x0049, 0x004a, 0x0178 },
 };
 
+static constexpr bool isSortedByKeycode(const QKeyboardMap::Mapping *map, size_t size)
+{
+    for (size_t i = 1; i < size; ++i) {
+        if (map[i - 1].keycode > map[i].keycode)
+            return false;
+    }
+    return true;
+}
+
+static_assert(isSortedByKeycode(s_keymap_default,
+                                sizeof(s_keymap_default) / sizeof(s_keymap_default[0])),
+              "the built-in keymap must stay sorted by keycode");
+
 #endif // QVXKEYBOARDHANDLER_DEFAULTMAP_P_H
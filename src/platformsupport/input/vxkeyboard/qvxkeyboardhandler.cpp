@@ -7,8 +7,11 @@
 #include <qplatformdefs.h>
 
 #include <QFile>
+#include <QPromise>
 #include <QSocketNotifier>
 #include <QStringList>
+#include <QThreadPool>
+#include <QtEndian>
 #include <QCoreApplication>
 #include <QLoggingCategory>
 #include <qpa/qwindowsysteminterface.h>
@@ -19,6 +22,15 @@
 
 #include <evdevLib.h>
 
+#include <algorithm>
+#include <array>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(Q_PROCESSOR_ARM_64)
+#  include <arm_neon.h>
+#endif
+
 #ifndef input_event_sec
 #define input_event_sec time.tv_sec
 #endif
@@ -37,20 +49,41 @@ Q_STATIC_LOGGING_CATEGORY(qLcVxKeyMap, "qt.qpa.input.keymap")
 // simple builtin US keymap
 #include "qvxkeyboard_defaultmap_p.h"
 
+// every possible raw modifier state mapped to Qt modifiers at compile time,
+// so the per-event conversion becomes a single table load
+static constexpr auto qtModifiersTable = [] {
+    std::array<Qt::KeyboardModifiers, 256> table = {};
+    for (std::size_t i = 0; i < table.size(); ++i)
+        table[i] = QVxKeyboardHandler::toQtModifiers(quint8(i));
+    return table;
+}();
+
 QVxKeyboardHandler::QVxKeyboardHandler(const QString &device, QFdContainer &fd, bool disableZap, bool enableCompose, const QString &keymapFile)
     : m_device(device), m_fd(fd.release()), m_notify(nullptr),
-      m_modifiers(0), m_composing(0), m_dead_unicode(0xffff),
+      m_modifiers(0), m_lastPushedModifiers(0xffff), m_composing(0), m_dead_unicode(0xffff),
       m_langLock(0), m_no_zap(disableZap), m_do_compose(enableCompose),
+      m_processKeycode(enableCompose ? &QVxKeyboardHandler::processKeycodeImpl<true>
+                                     : &QVxKeyboardHandler::processKeycodeImpl<false>),
       m_keymap(0), m_keymap_size(0), m_keycompose(0), m_keycompose_size(0)
 {
     qCDebug(qLcVxKey) << "Create keyboard handler with for device" << device;
 
     setObjectName("VxWorksInput Keyboard Handler"_L1);
 
-    memset(m_locks, 0, sizeof(m_locks));
+    for (auto &lock : m_locks)
+        lock.store(0, std::memory_order_relaxed);
+    m_textBuf.resize(1);
 
-    if (keymapFile.isEmpty() || !loadKeymap(keymapFile))
-        unloadKeymap();
+    connect(&m_keymapWatcher, &QFutureWatcher<ParsedKeymapPtr>::finished,
+            this, [this] { installKeymap(m_keymapWatcher.result()); });
+
+    // install the built-in keymap right away so the handler is usable
+    // immediately; a custom keymap is parsed on the thread pool and swapped
+    // in through the event loop once ready, keeping the file I/O off the
+    // GUI thread
+    unloadKeymap();
+    if (!keymapFile.isEmpty())
+        loadKeymapAsync(keymapFile);
 
     // socket notifier for events on the keyboard device
     m_notify = new QSocketNotifier(m_fd.get(), QSocketNotifier::Read, this);
@@ -59,7 +92,18 @@ QVxKeyboardHandler::QVxKeyboardHandler(const QString &device, QFdContainer &fd,
 
 QVxKeyboardHandler::~QVxKeyboardHandler()
 {
+    // a keymap parse may still be running on the thread pool; it does not
+    // touch the handler, but wait for it so the future does not outlive
+    // its watcher
+    if (m_keymapWatcher.isRunning())
+        m_keymapWatcher.waitForFinished();
+
     unloadKeymap();
+
+    delete [] m_kmIdx.keycodes;
+    delete [] m_kmIdx.modifiers;
+    delete [] m_kmIdx.flags;
+    delete [] m_kmIdx.categories;
 }
 
 std::unique_ptr<QVxKeyboardHandler> QVxKeyboardHandler::create(const QString &device,
@@ -79,25 +123,28 @@ std::unique_ptr<QVxKeyboardHandler> QVxKeyboardHandler::create(const QString &de
     const auto args = QStringView{specification}.split(u':');
     for (const auto &arg : args) {
         if (arg.startsWith("keymap="_L1))
-            keymapFile = arg.mid(7).toString();
+            keymapFile = arg.sliced(7).toString(); // the only argument that needs a QString
         else if (arg == "disable-zap"_L1)
             disableZap = true;
         else if (arg == "enable-compose"_L1)
             enableCompose = true;
         else if (arg.startsWith("repeat-delay="_L1))
-            repeatDelay = arg.mid(13).toInt();
+            repeatDelay = arg.sliced(13).toInt();
         else if (arg.startsWith("repeat-rate="_L1))
-            repeatRate = arg.mid(12).toInt();
+            repeatRate = arg.sliced(12).toInt();
         else if (arg.startsWith("grab="_L1))
-            grab = arg.mid(5).toInt();
+            grab = arg.sliced(5).toInt();
     }
 
     qCDebug(qLcVxKey, "Opening keyboard at %ls", qUtf16Printable(device));
 
-    QFdContainer fd(qt_safe_open(device.toLocal8Bit().constData(), O_RDWR | O_NDELAY, 0));
-    if (fd.get() < 0) {
+    // qt_safe_open() already adds O_CLOEXEC; only fall back to read-only
+    // when it was the write access that got denied, as any other failure
+    // would just fail the second open the same way
+    QFdContainer fd(qt_safe_open(device.toLocal8Bit().constData(), O_RDWR | O_NONBLOCK, 0));
+    if (fd.get() < 0 && (errno == EACCES || errno == EROFS)) {
         qCDebug(qLcVxKey, "Keyboard device could not be opened as read-write, trying read-only");
-        fd.reset(qt_safe_open(device.toLocal8Bit().constData(), O_RDONLY | O_NDELAY, 0));
+        fd.reset(qt_safe_open(device.toLocal8Bit().constData(), O_RDONLY | O_NONBLOCK, 0));
     }
     if (fd.get() >= 0) {
         UINT32 kbdMode = EV_DEV_KBD_KEYCODE_MODE;
@@ -115,53 +162,175 @@ std::unique_ptr<QVxKeyboardHandler> QVxKeyboardHandler::create(const QString &de
 
 void QVxKeyboardHandler::readKeycode()
 {
-    EV_DEV_EVENT ev;
-    int n = ERROR;
+    // keep the notifier quiet while draining the device, so the dispatcher
+    // does not re-arm and re-fire it for every batch during a burst
+    if (m_notify)
+        m_notify->setEnabled(false);
 
-    while (n == ERROR) {
-        n = qt_safe_read(m_fd.get(), (char *)(&ev), sizeof(EV_DEV_EVENT));
+    EV_DEV_EVENT buffer[32];
+    int n = 0;
 
-        if (n == 0) {
-            qWarning("vxkeyboard: Got EOF from the input device");
-            return;
-        }
+    forever {
+        int result = qt_safe_read(m_fd.get(), reinterpret_cast<char *>(buffer) + n, sizeof(buffer) - n);
 
-        if (n == ERROR) {
-            if (errno == EINTR || errno == EAGAIN)
-                continue;
+        if (result == 0) {
+            qWarning("vxkeyboard: Got EOF from the input device");
+            break;
+        } else if (result < 0) {
+            // qt_safe_read() already loops on EINTR, so a failure here is a
+            // real error or EAGAIN on the non-blocking fd
+            if (errno != EAGAIN) {
+                qErrnoWarning("vxkeyboard: Could not read from input device");
+                // If the device got disconnected, stop reading, otherwise we get flooded
+                // by the above error over and over again.
+                if (errno == ENXIO) {
+                    delete m_notify;
+                    m_notify = nullptr;
+                    m_fd.reset();
+                }
+                break;
+            }
+            if (n == 0)
+                break; // the fd is O_NONBLOCK: the device is fully drained
+            // EAGAIN with a partial event buffered: read on for its tail
+        } else {
+            n += result;
+            if (n % sizeof(buffer[0]) != 0)
+                continue; // partial event, keep reading
+
+            const int count = n / int(sizeof(buffer[0]));
+            n = 0;
+
+            for (int i = 0; i < count; ++i) {
+                if (buffer[i].type != EV_DEV_KEY)
+                    continue;
+
+                quint16 code = buffer[i].code;
+                qint32 value = buffer[i].value;
+
+                // Coalesce auto-repeats: when the consumer falls behind,
+                // repeats of the held key pile up within one batch.
+                // Delivering only the last repeat of such a run avoids
+                // flooding the QPA event queue; a release of the same key
+                // ends the run and is never skipped.
+                if (value == 2) {
+                    bool superseded = false;
+                    for (int j = i + 1; j < count; ++j) {
+                        if (buffer[j].type == EV_DEV_KEY && buffer[j].code == code) {
+                            superseded = (buffer[j].value == 2);
+                            break;
+                        }
+                    }
+                    if (superseded)
+                        continue;
+                }
 
-            qErrnoWarning("vxkeyboard: Could not read from input device");
-            if (errno == ENXIO) {
-                delete m_notify;
-                m_notify = nullptr;
-                m_fd.reset();
+                processKeycode(code, value != 0, value == 2);
             }
-            return;
         }
     }
 
-    if (n < sizeof(EV_DEV_EVENT)) return;
-    if (ev.type != EV_DEV_KEY) return;
-
-    quint16 code = ev.code;
-    qint32 value = ev.value;
-
-    processKeycode(code, value != 0, value == 2);
+    if (m_notify)
+        m_notify->setEnabled(true);
 }
 
 void QVxKeyboardHandler::processKeyEvent(int nativecode, int unicode, int qtcode,
                                             Qt::KeyboardModifiers modifiers, bool isPress, bool autoRepeat)
 {
-    if (!autoRepeat)
-        QGuiApplicationPrivate::inputDeviceManager()->setKeyboardModifiers(QVxKeyboardHandler::toQtModifiers(m_modifiers));
+    // pushing the modifier state fans out Qt-wide; only do it when the
+    // state actually changed since the last push
+    const quint8 mods = m_modifiers.load(std::memory_order_relaxed);
+    if (!autoRepeat && mods != m_lastPushedModifiers) {
+        QGuiApplicationPrivate::inputDeviceManager()->setKeyboardModifiers(qtModifiersTable[mods]);
+        m_lastPushedModifiers = mods;
+    }
+
+    // reuse the preallocated one-character buffer instead of constructing a
+    // QString per keystroke; data() only detaches (and reallocates) when the
+    // previous event's copy is still referenced somewhere
+    if (unicode != 0xffff)
+        m_textBuf.data()[0] = QChar(unicode);
 
     QWindow *window = nullptr;
     QWindowSystemInterface::handleExtendedKeyEvent(window, (isPress ? QEvent::KeyPress : QEvent::KeyRelease),
                                                    qtcode, modifiers, nativecode + 8, 0, int(modifiers),
-                                                   (unicode != 0xffff ) ? QString(QChar(unicode)) : QString(), autoRepeat);
+                                                   (unicode != 0xffff ) ? m_textBuf : QString(), autoRepeat);
+}
+
+// Locate the run of entries equal to \a target in the sorted keycode column.
+// Returns the index of the first matching entry and stores the length of the
+// run in *count (0 if there is no match). Where vector units are available
+// the column is swept 16 (AVX2) or 8 (NEON) keycodes per iteration; the
+// scalar build keeps the binary search instead.
+static int findKeycodeRun(const quint16 *kc, int n, quint16 target, int *count)
+{
+    int first = n;
+#if defined(__AVX2__)
+    const __m256i vtarget = _mm256_set1_epi16(short(target));
+    int i = 0;
+    for ( ; i + 16 <= n; i += 16) {
+        const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kc + i));
+        const quint32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(chunk, vtarget));
+        if (mask) {
+            first = i + int(qCountTrailingZeroBits(mask)) / 2;
+            break;
+        }
+        if (kc[i + 15] > target) { // sorted: no match further right
+            *count = 0;
+            return n;
+        }
+    }
+    if (first == n) {
+        for ( ; i < n; ++i) {
+            if (kc[i] == target) {
+                first = i;
+                break;
+            }
+        }
+    }
+#elif defined(__ARM_NEON) && defined(Q_PROCESSOR_ARM_64)
+    const uint16x8_t vtarget = vdupq_n_u16(target);
+    int i = 0;
+    for ( ; i + 8 <= n; i += 8) {
+        const uint16x8_t chunk = vld1q_u16(kc + i);
+        if (vmaxvq_u16(vceqq_u16(chunk, vtarget))) {
+            while (kc[i] != target)
+                ++i;
+            first = i;
+            break;
+        }
+        if (kc[i + 7] > target) { // sorted: no match further right
+            *count = 0;
+            return n;
+        }
+    }
+    if (first == n) {
+        for ( ; i < n; ++i) {
+            if (kc[i] == target) {
+                first = i;
+                break;
+            }
+        }
+    }
+#else
+    const quint16 *it = std::lower_bound(kc, kc + n, target);
+    if (it != kc + n && *it == target)
+        first = int(it - kc);
+#endif
+    int len = 0;
+    while (first + len < n && kc[first + len] == target)
+        ++len;
+    *count = len;
+    return first;
 }
 
 QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed, bool autorepeat)
+{
+    return (this->*m_processKeycode)(keycode, pressed, autorepeat);
+}
+
+template <bool Compose>
+QKeycodeAction QVxKeyboardHandler::processKeycodeImpl(quint16 keycode, bool pressed, bool autorepeat)
 {
     QKeycodeAction result = QKeycodeAction::None;
     bool first_press = pressed && !autorepeat;
@@ -169,26 +338,46 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
     const QKeyboardMap::Mapping *map_plain = nullptr;
     const QKeyboardMap::Mapping *map_withmod = nullptr;
 
-    quint8 modifiers = m_modifiers;
-
-    // get a specific and plain mapping for the keycode and the current modifiers
-    for (int i = 0; i < m_keymap_size && !(map_plain && map_withmod); ++i) {
-        const QKeyboardMap::Mapping *m = m_keymap + i;
-        if (m->keycode == keycode) {
-            if (m->modifiers == 0)
-                map_plain = m;
-
-            quint8 testmods = m_modifiers;
-            if (m_locks[0] /*CapsLock*/ && (m->flags & QKeyboardMap::IsLetter))
-                testmods ^= QKeyboardMap::ModShift;
-            if (m_langLock)
-                testmods ^= QKeyboardMap::ModAltGr;
-            if (m->modifiers == testmods)
-                map_withmod = m;
-        }
+    quint8 modifiers = m_modifiers.load(std::memory_order_relaxed);
+
+    // the keymap is sorted by keycode (loaded maps are sorted in loadKeymap(),
+    // the built-in map is generated sorted)
+    // and m_keymapIndex records the run of entries for each keycode, so the
+    // lookup is a single dereference; fall back to a binary search for the
+    // few keycodes beyond the index
+    int lo, hi;
+    if (keycode < KeymapIndexSize) {
+        const KeymapBucket &b = m_keymapIndex[keycode];
+        if (b.plainIdx >= 0)
+            map_plain = m_keymap + b.plainIdx;
+        lo = b.start;
+        hi = b.start + b.count;
+    } else {
+        int count;
+        lo = findKeycodeRun(m_kmIdx.keycodes, m_keymap_size, keycode, &count);
+        hi = lo + count;
+    }
+
+    // CapsLock and the language lock are invariant across the scan: fold
+    // them into XOR masks up front so the loop body is branch-free
+    const quint8 capsLock = m_locks[0].load(std::memory_order_relaxed);
+    const quint8 baseMods = modifiers
+        ^ (m_langLock.load(std::memory_order_relaxed) ? quint8(QKeyboardMap::ModAltGr) : quint8(0));
+    const quint8 capsXor = capsLock ? quint8(QKeyboardMap::ModShift) : quint8(0);
+
+    // filter on the packed columns only; the full Mapping entry is touched
+    // just once a match has been made
+    for (int i = lo; i != hi && !(map_plain && map_withmod); ++i) {
+        if (!map_plain && m_kmIdx.modifiers[i] == 0)
+            map_plain = m_keymap + i;
+
+        const quint8 isLetter = quint8(-((m_kmIdx.flags[i] & QKeyboardMap::IsLetter) != 0)); // 0x00 or 0xff
+        const quint8 testmods = baseMods ^ (isLetter & capsXor);
+        if (m_kmIdx.modifiers[i] == testmods)
+            map_withmod = m_keymap + i;
     }
 
-    if (m_locks[0] && map_withmod && (map_withmod->flags & QKeyboardMap::IsLetter))
+    if (capsLock && map_withmod && (map_withmod->flags & QKeyboardMap::IsLetter))
         modifiers ^= QKeyboardMap::ModShift;
 
     qCDebug(qLcVxKeyMap, "Processing key event: keycode=%3d, modifiers=%02x pressed=%d, autorepeat=%d  |  plain=%d, withmod=%d, size=%d",
@@ -209,17 +398,20 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
     quint16 unicode = it->unicode;
     quint32 qtcode = it->qtcode;
 
-    if ((it->flags & QKeyboardMap::IsModifier) && it->special) {
+    switch (m_kmIdx.categories[it - m_keymap]) {
+    case CatModifier:
         // this is a modifier, i.e. Shift, Alt, ...
         if (pressed)
-            m_modifiers |= quint8(it->special);
+            m_modifiers.fetch_or(quint8(it->special), std::memory_order_relaxed);
         else
-            m_modifiers &= ~quint8(it->special);
-    } else if (qtcode >= Qt::Key_CapsLock && qtcode <= Qt::Key_ScrollLock) {
+            m_modifiers.fetch_and(quint8(~it->special), std::memory_order_relaxed);
+        break;
+
+    case CatLock:
         // (Caps|Num|Scroll)Lock
         if (first_press) {
-            quint8 &lock = m_locks[qtcode - Qt::Key_CapsLock];
-            lock ^= 1;
+            const quint8 lock
+                = m_locks[qtcode - Qt::Key_CapsLock].fetch_xor(1, std::memory_order_relaxed) ^ 1;
 
             switch (qtcode) {
             case Qt::Key_CapsLock  : result = lock ? QKeycodeAction::CapsLockOn : QKeycodeAction::CapsLockOff; break;
@@ -228,7 +420,13 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
             default                : break;
             }
         }
-    } else if ((it->flags & QKeyboardMap::IsSystem) && it->special && first_press) {
+        break;
+
+    case CatSystem:
+        // the release of a system key is reported like a normal one
+        if (!first_press)
+            break;
+
         switch (it->special) {
         case QKeyboardMap::SystemReboot:
             result = QKeycodeAction::Reboot;
@@ -259,13 +457,22 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
         }
 
         skip = true; // no need to tell Qt about it
-    } else if ((qtcode == Qt::Key_Multi_key) && m_do_compose) {
+        break;
+
+    case CatCompose:
         // the Compose key was pressed
-        if (first_press)
-            m_composing = 2;
-        skip = true;
-    } else if ((it->flags & QKeyboardMap::IsDead) && m_do_compose) {
+        if (Compose) {
+            if (first_press)
+                m_composing = 2;
+            skip = true;
+        }
+        break;
+
+    case CatDead:
         // a Dead key was pressed
+        if (!Compose)
+            break;
+
         if (first_press && m_composing == 1 && m_dead_unicode == unicode) { // twice
             m_composing = 0;
             qtcode = Qt::Key_unknown; // otherwise it would be Qt::Key_Dead...
@@ -276,6 +483,11 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
         } else {
             skip = true;
         }
+        break;
+
+    case CatNormal:
+    default:
+        break;
     }
 
     if (!skip) {
@@ -287,19 +499,14 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
         // so just report the plain mapping with additional modifiers.
         if ((it == map_plain && it != map_withmod) ||
             (map_withmod && !(map_withmod->qtcode & modmask))) {
-            qtcode |= QVxKeyboardHandler::toQtModifiers(modifiers);
+            qtcode |= qtModifiersTable[modifiers];
         }
 
-        if (m_composing == 2 && first_press && !(it->flags & QKeyboardMap::IsModifier)) {
+        if (Compose && m_composing == 2 && first_press && !(it->flags & QKeyboardMap::IsModifier)) {
             // the last key press was the Compose key
             if (unicode != 0xffff) {
-                int idx = 0;
                 // check if this code is in the compose table at all
-                for ( ; idx < m_keycompose_size; ++idx) {
-                    if (m_keycompose[idx].first == unicode)
-                        break;
-                }
-                if (idx < m_keycompose_size) {
+                if (m_composeFirsts.contains(unicode)) {
                     // found it -> simulate a Dead key press
                     m_dead_unicode = unicode;
                     unicode = 0xffff;
@@ -311,18 +518,14 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
             } else {
                 m_composing = 0;
             }
-        } else if (m_composing == 1 && first_press && !(it->flags & QKeyboardMap::IsModifier)) {
+        } else if (Compose && m_composing == 1 && first_press && !(it->flags & QKeyboardMap::IsModifier)) {
             // the last key press was a Dead key
             bool valid = false;
             if (unicode != 0xffff) {
-                int idx = 0;
-                // check if this code is in the compose table at all
-                for ( ; idx < m_keycompose_size; ++idx) {
-                    if (m_keycompose[idx].first == m_dead_unicode && m_keycompose[idx].second == unicode)
-                        break;
-                }
-                if (idx < m_keycompose_size) {
-                    quint16 composed = m_keycompose[idx].result;
+                // check if this combination is in the compose table at all
+                const auto idx = m_composeMap.constFind((quint32(m_dead_unicode) << 16) | unicode);
+                if (idx != m_composeMap.cend()) {
+                    quint16 composed = idx.value();
                     if (composed != 0xffff) {
                         unicode = composed;
                         qtcode = Qt::Key_unknown;
@@ -347,48 +550,26 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
             qCDebug(qLcVxKeyMap, "Processing: uni=%04x, qt=%08x, qtmod=%08x", unicode, qtcode, int(qtmods));
 
             // If NumLockOff and keypad key pressed remap event sent
-            if (!m_locks[1] && (qtmods & Qt::KeypadModifier) &&
-                 keycode >= 71 &&
-                 keycode <= 83 &&
-                 keycode != 74 &&
-                 keycode != 78) {
-
+            static constexpr quint32 numpadRemap[13] = {
+                Qt::Key_Home,     // 71: 7
+                Qt::Key_Up,       // 72: 8
+                Qt::Key_PageUp,   // 73: 9
+                0,                // 74: - (not remapped)
+                Qt::Key_Left,     // 75: 4
+                Qt::Key_Clear,    // 76: 5
+                Qt::Key_Right,    // 77: 6
+                0,                // 78: + (not remapped)
+                Qt::Key_End,      // 79: 1
+                Qt::Key_Down,     // 80: 2
+                Qt::Key_PageDown, // 81: 3
+                Qt::Key_Insert,   // 82: 0
+                Qt::Key_Delete    // 83: ,
+            };
+            // one mask test covers the 71..83 range and the 74/78 holes
+            if (!m_locks[1].load(std::memory_order_relaxed) && (qtmods & Qt::KeypadModifier)
+                && quint16(keycode - 71) < 13 && ((1u << (keycode - 71)) & 0x1f77)) {
                 unicode = 0xffff;
-                switch (keycode) {
-                case 71: //7 --> Home
-                    qtcode = Qt::Key_Home;
-                    break;
-                case 72: //8 --> Up
-                    qtcode = Qt::Key_Up;
-                    break;
-                case 73: //9 --> PgUp
-                    qtcode = Qt::Key_PageUp;
-                    break;
-                case 75: //4 --> Left
-                    qtcode = Qt::Key_Left;
-                    break;
-                case 76: //5 --> Clear
-                    qtcode = Qt::Key_Clear;
-                    break;
-                case 77: //6 --> right
-                    qtcode = Qt::Key_Right;
-                    break;
-                case 79: //1 --> End
-                    qtcode = Qt::Key_End;
-                    break;
-                case 80: //2 --> Down
-                    qtcode = Qt::Key_Down;
-                    break;
-                case 81: //3 --> PgDn
-                    qtcode = Qt::Key_PageDown;
-                    break;
-                case 82: //0 --> Ins
-                    qtcode = Qt::Key_Insert;
-                    break;
-                case 83: //, --> Del
-                    qtcode = Qt::Key_Delete;
-                    break;
-                }
+                qtcode = numpadRemap[keycode - 71];
             }
 
             // Map SHIFT + Tab to SHIFT + Backtab, QShortcutMap knows about this translation
@@ -402,6 +583,70 @@ QKeycodeAction QVxKeyboardHandler::processKeycode(quint16 keycode, bool pressed,
     return result;
 }
 
+void QVxKeyboardHandler::updateKeymapIndex()
+{
+    // m_keymap is sorted by keycode, so all entries for one keycode form a
+    // contiguous run; record the runs for O(1) lookup in processKeycode()
+    for (int i = 0; i < KeymapIndexSize; ++i)
+        m_keymapIndex[i] = { -1, 0, 0 };
+
+    delete [] m_kmIdx.keycodes;
+    delete [] m_kmIdx.modifiers;
+    delete [] m_kmIdx.flags;
+    delete [] m_kmIdx.categories;
+    m_kmIdx.keycodes = new quint16[m_keymap_size];
+    m_kmIdx.modifiers = new quint8[m_keymap_size];
+    m_kmIdx.flags = new quint8[m_keymap_size];
+    m_kmIdx.categories = new quint8[m_keymap_size];
+
+    for (int i = 0; i < m_keymap_size; ++i) {
+        const QKeyboardMap::Mapping &m = m_keymap[i];
+        const quint16 kc = m.keycode;
+        m_kmIdx.keycodes[i] = kc;
+        m_kmIdx.modifiers[i] = m.modifiers;
+        m_kmIdx.flags[i] = m.flags;
+
+        quint8 cat = CatNormal;
+        if ((m.flags & QKeyboardMap::IsModifier) && m.special)
+            cat = CatModifier;
+        else if (m.qtcode >= Qt::Key_CapsLock && m.qtcode <= Qt::Key_ScrollLock)
+            cat = CatLock;
+        else if ((m.flags & QKeyboardMap::IsSystem) && m.special)
+            cat = CatSystem;
+        else if (m.qtcode == Qt::Key_Multi_key)
+            cat = CatCompose;
+        else if (m.flags & QKeyboardMap::IsDead)
+            cat = CatDead;
+        m_kmIdx.categories[i] = cat;
+
+        if (kc >= KeymapIndexSize)
+            continue;
+        KeymapBucket &b = m_keymapIndex[kc];
+        if (b.count == 0)
+            b.start = i;
+        ++b.count;
+        if (b.plainIdx < 0 && m_keymap[i].modifiers == 0)
+            b.plainIdx = i;
+    }
+}
+
+void QVxKeyboardHandler::updateComposeIndex()
+{
+    // hash the compose table so the lookups in processKeycode() are O(1)
+    m_composeFirsts.clear();
+    m_composeMap.clear();
+    m_composeFirsts.reserve(m_keycompose_size);
+    m_composeMap.reserve(m_keycompose_size);
+
+    for (int i = 0; i < m_keycompose_size; ++i) {
+        const QKeyboardMap::Composing &c = m_keycompose[i];
+        m_composeFirsts.insert(c.first);
+        const quint32 key = (quint32(c.first) << 16) | c.second;
+        if (!m_composeMap.contains(key)) // the first entry wins, as in the old scan
+            m_composeMap.insert(key, c.result);
+    }
+}
+
 void QVxKeyboardHandler::unloadKeymap()
 {
     qCDebug(qLcVxKey, "Unload current keymap and restore built-in");
@@ -416,16 +661,21 @@ void QVxKeyboardHandler::unloadKeymap()
     m_keycompose = s_keycompose_default;
     m_keycompose_size = sizeof(s_keycompose_default) / sizeof(s_keycompose_default[0]);
 
+    updateKeymapIndex();
+    updateComposeIndex();
+
     // reset state, so we could switch keymaps at runtime
-    m_modifiers = 0;
-    memset(m_locks, 0, sizeof(m_locks));
+    m_modifiers.store(0, std::memory_order_relaxed);
+    m_lastPushedModifiers = 0xffff;
+    for (auto &lock : m_locks)
+        lock.store(0, std::memory_order_relaxed);
     m_composing = 0;
     m_dead_unicode = 0xffff;
 
-    m_langLock = 0;
+    m_langLock.store(0, std::memory_order_relaxed);
 }
 
-bool QVxKeyboardHandler::loadKeymap(const QString &file)
+QVxKeyboardHandler::ParsedKeymapPtr QVxKeyboardHandler::parseKeymap(const QString &file)
 {
     qCDebug(qLcVxKey, "Loading keymap %ls", qUtf16Printable(file));
 
@@ -433,60 +683,126 @@ bool QVxKeyboardHandler::loadKeymap(const QString &file)
 
     if (!f.open(QIODevice::ReadOnly)) {
         qWarning("Could not open keymap file '%ls'", qUtf16Printable(file));
-        return false;
+        return nullptr;
     }
 
-    // .qmap files have a very simple structure:
+    // .qmap files have a very simple structure (all fields big-endian, as
+    // written through QDataStream by kmap2qmap):
     // quint32 magic           (QKeyboard::FileMagic)
     // quint32 version         (1)
     // quint32 keymap_size     (# of struct QKeyboard::Mappings)
     // quint32 keycompose_size (# of struct QKeyboard::Composings)
-    // all QKeyboard::Mappings via QDataStream::operator(<<|>>)
-    // all QKeyboard::Composings via QDataStream::operator(<<|>>)
-
-    quint32 qmap_magic, qmap_version, qmap_keymap_size, qmap_keycompose_size;
-
-    QDataStream ds(&f);
+    // all QKeyboard::Mappings
+    // all QKeyboard::Composings
+
+    const qint64 headerSize = 4 * sizeof(quint32);
+    const qint64 mappingSize = 12;   // serialized size, not sizeof(Mapping)
+    const qint64 composingSize = 6;
+
+    // map the file instead of pulling it field by field through QDataStream;
+    // the bounds are validated once up front, so deserialization cannot fail
+    // halfway through
+    const qint64 fileSize = f.size();
+    const uchar *p = fileSize >= headerSize ? f.map(0, fileSize) : nullptr;
+    if (!p) {
+        qWarning("'%ls' is not a valid .qmap keymap file", qUtf16Printable(file));
+        return nullptr;
+    }
 
-    ds >> qmap_magic >> qmap_version >> qmap_keymap_size >> qmap_keycompose_size;
+    const quint32 qmap_magic = qFromBigEndian<quint32>(p); p += 4;
+    const quint32 qmap_version = qFromBigEndian<quint32>(p); p += 4;
+    const quint32 qmap_keymap_size = qFromBigEndian<quint32>(p); p += 4;
+    const quint32 qmap_keycompose_size = qFromBigEndian<quint32>(p); p += 4;
 
-    if (ds.status() != QDataStream::Ok || qmap_magic != QKeyboardMap::FileMagic || qmap_version != 1 || qmap_keymap_size == 0) {
+    if (qmap_magic != QKeyboardMap::FileMagic || qmap_version != 1 || qmap_keymap_size == 0
+        || fileSize - headerSize < mappingSize * qmap_keymap_size + composingSize * qmap_keycompose_size) {
         qWarning("'%ls' is not a valid .qmap keymap file", qUtf16Printable(file));
-        return false;
+        return nullptr;
     }
 
-    QKeyboardMap::Mapping *qmap_keymap = new QKeyboardMap::Mapping[qmap_keymap_size];
-    QKeyboardMap::Composing *qmap_keycompose = qmap_keycompose_size ? new QKeyboardMap::Composing[qmap_keycompose_size] : 0;
+    auto parsed = std::make_shared<ParsedKeymap>();
+    parsed->keymap.reset(new QKeyboardMap::Mapping[qmap_keymap_size]);
+    parsed->keymap_size = qmap_keymap_size;
+    if (qmap_keycompose_size) {
+        parsed->keycompose.reset(new QKeyboardMap::Composing[qmap_keycompose_size]);
+        parsed->keycompose_size = qmap_keycompose_size;
+    }
 
-    for (quint32 i = 0; i < qmap_keymap_size; ++i)
-        ds >> qmap_keymap[i];
-    for (quint32 i = 0; i < qmap_keycompose_size; ++i)
-        ds >> qmap_keycompose[i];
+    for (quint32 i = 0; i < qmap_keymap_size; ++i) {
+        QKeyboardMap::Mapping &m = parsed->keymap[i];
+        m.keycode = qFromBigEndian<quint16>(p); p += 2;
+        m.unicode = qFromBigEndian<quint16>(p); p += 2;
+        m.qtcode = qFromBigEndian<quint32>(p); p += 4;
+        m.modifiers = *p++;
+        m.flags = *p++;
+        m.special = qFromBigEndian<quint16>(p); p += 2;
+    }
+    for (quint32 i = 0; i < qmap_keycompose_size; ++i) {
+        QKeyboardMap::Composing &c = parsed->keycompose[i];
+        c.first = qFromBigEndian<quint16>(p); p += 2;
+        c.second = qFromBigEndian<quint16>(p); p += 2;
+        c.result = qFromBigEndian<quint16>(p); p += 2;
+    }
+
+    // processKeycode() binary-searches the keymap, so keep it sorted by keycode
+    std::stable_sort(parsed->keymap.get(), parsed->keymap.get() + qmap_keymap_size,
+                     [](const QKeyboardMap::Mapping &a, const QKeyboardMap::Mapping &b) {
+                         return a.keycode < b.keycode;
+                     });
 
-    if (ds.status() != QDataStream::Ok) {
-        delete [] qmap_keymap;
-        delete [] qmap_keycompose;
+    return parsed;
+}
 
-        qWarning("Keymap file '%ls' cannot be loaded.", qUtf16Printable(file));
+bool QVxKeyboardHandler::installKeymap(const ParsedKeymapPtr &parsed)
+{
+    if (!parsed)
         return false;
-    }
 
-    // unload currently active and clear state
-    unloadKeymap();
+    // The new tables are fully built and validated at this point: swap them
+    // in directly instead of bouncing through unloadKeymap(), which would
+    // restore the defaults just to overwrite them a line later and would
+    // needlessly reset the modifier, lock and composing state.
+    if (m_keymap && m_keymap != s_keymap_default)
+        delete [] m_keymap;
+    if (m_keycompose && m_keycompose != s_keycompose_default)
+        delete [] m_keycompose;
+
+    m_keymap = parsed->keymap.release();
+    m_keymap_size = parsed->keymap_size;
+    m_keycompose = parsed->keycompose.release();
+    m_keycompose_size = parsed->keycompose_size;
 
-    m_keymap = qmap_keymap;
-    m_keymap_size = qmap_keymap_size;
-    m_keycompose = qmap_keycompose;
-    m_keycompose_size = qmap_keycompose_size;
+    updateKeymapIndex();
+    updateComposeIndex();
 
     m_do_compose = true;
+    m_processKeycode = &QVxKeyboardHandler::processKeycodeImpl<true>;
 
     return true;
 }
 
+void QVxKeyboardHandler::loadKeymapAsync(const QString &file)
+{
+    // parseKeymap() reads only the file, so it can run on the global thread
+    // pool; the watcher delivers the result back on the handler's thread,
+    // where installKeymap() swaps the tables in between key events
+    auto promise = std::make_shared<QPromise<ParsedKeymapPtr>>();
+    m_keymapWatcher.setFuture(promise->future());
+    QThreadPool::globalInstance()->start([promise, file] {
+        promise->start();
+        promise->addResult(parseKeymap(file));
+        promise->finish();
+    });
+}
+
+bool QVxKeyboardHandler::loadKeymap(const QString &file)
+{
+    return installKeymap(parseKeymap(file));
+}
+
 void QVxKeyboardHandler::switchLang()
 {
-    m_langLock ^= 1;
+    m_langLock.fetch_xor(1, std::memory_order_relaxed);
 }
 
 QT_END_NAMESPACE
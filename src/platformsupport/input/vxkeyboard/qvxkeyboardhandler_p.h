@@ -22,8 +22,12 @@
 #include <QtInputSupport/private/qkeycodeaction_p.h>
 
 #include <QDataStream>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QSet>
 #include <private/qglobal_p.h>
 
+#include <atomic>
 #include <memory>
 
 QT_BEGIN_NAMESPACE
@@ -112,7 +116,7 @@ public:
                                          const QString &specification,
                                          const QString &defaultKeymapFile = QString());
 
-    static Qt::KeyboardModifiers toQtModifiers(quint8 mod)
+    static constexpr Qt::KeyboardModifiers toQtModifiers(quint8 mod)
     {
         Qt::KeyboardModifiers qtmod = Qt::NoModifier;
 
@@ -138,27 +142,92 @@ private:
     void processKeyEvent(int nativecode, int unicode, int qtcode,
                          Qt::KeyboardModifiers modifiers, bool isPress, bool autoRepeat);
 
+    // a keymap parsed from a .qmap file; built on a worker thread without
+    // touching the handler, ownership of the arrays moves to the handler
+    // when the tables are installed
+    struct ParsedKeymap {
+        std::unique_ptr<QKeyboardMap::Mapping[]> keymap;
+        quint32 keymap_size = 0;
+        std::unique_ptr<QKeyboardMap::Composing[]> keycompose;
+        quint32 keycompose_size = 0;
+    };
+    using ParsedKeymapPtr = std::shared_ptr<ParsedKeymap>;
+
+    static ParsedKeymapPtr parseKeymap(const QString &file);
+    bool installKeymap(const ParsedKeymapPtr &parsed);
+    void loadKeymapAsync(const QString &file);
+
+    // m_do_compose never changes between keymap loads, so processKeycode()
+    // dispatches to a variant with the compose handling compiled in or out
+    template <bool Compose>
+    QKeycodeAction processKeycodeImpl(quint16 keycode, bool pressed, bool autorepeat);
+
+    void updateKeymapIndex();
+    void updateComposeIndex();
+
     QString m_device;
     QFdContainer m_fd;
     QSocketNotifier *m_notify;
 
-    // keymap handling
-    quint8 m_modifiers;
-    quint8 m_locks[3];
+    // keymap handling; the modifier, lock and language state is atomic so
+    // it can be observed (and m_langLock toggled via switchLang()) from
+    // other threads without a lock — relaxed loads and stores compile to
+    // plain accesses on our targets
+    std::atomic<quint8> m_modifiers;
+    quint16 m_lastPushedModifiers; // last state handed to QInputDeviceManager, 0xffff if none yet
+    std::atomic<quint8> m_locks[3];
     int m_composing;
     quint16 m_dead_unicode;
-    quint8 m_langLock;
+    std::atomic<quint8> m_langLock;
 
     bool m_no_zap;
     bool m_do_compose;
+    QKeycodeAction (QVxKeyboardHandler::*m_processKeycode)(quint16, bool, bool);
+    QString m_textBuf; // reused one-character text payload for key events
 
     const QKeyboardMap::Mapping *m_keymap;
     int m_keymap_size;
     const QKeyboardMap::Composing *m_keycompose;
     int m_keycompose_size;
 
-    static const QKeyboardMap::Mapping s_keymap_default[];
-    static const QKeyboardMap::Composing s_keycompose_default[];
+    // hashed views of the compose table, keyed on (first << 16) | second
+    QHash<quint32, quint16> m_composeMap;
+    QSet<quint16> m_composeFirsts;
+
+    // delivers an off-thread keymap parse back to the handler's thread
+    QFutureWatcher<ParsedKeymapPtr> m_keymapWatcher;
+
+    // per-keycode index into the sorted m_keymap, so the hot lookup in
+    // processKeycode() is a single array dereference
+    struct KeymapBucket {
+        int plainIdx; // index of the modifiers == 0 entry, -1 if none
+        int start;    // first entry for this keycode
+        int count;    // number of entries for this keycode
+    };
+    static constexpr int KeymapIndexSize = 512; // covers all common evdev keycodes
+    KeymapBucket m_keymapIndex[KeymapIndexSize];
+
+    // classification of a mapping, precomputed at keymap load so the
+    // dispatch in processKeycode() is one switch instead of a chain of
+    // dependent flag tests; the order mirrors that chain
+    enum MappingCategory : quint8 {
+        CatNormal,
+        CatModifier,
+        CatLock,
+        CatSystem,
+        CatCompose,
+        CatDead
+    };
+
+    // parallel copies of the fields read by the keymap filter and dispatch,
+    // so the scan walks tightly packed columns instead of whole Mapping
+    // entries
+    struct KeymapIndexSoA {
+        quint16 *keycodes = nullptr;
+        quint8 *modifiers = nullptr;
+        quint8 *flags = nullptr;
+        quint8 *categories = nullptr;
+    } m_kmIdx;
 };
 
 